@@ -0,0 +1,131 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <new>
+#include <chrono>
+#include <vector>
+#include <cstdlib>
+#include <iostream>
+#include <filesystem>
+#include <gtest/gtest.h>
+#include "kls/Format.h"
+#include "kls/journal/Journal.h"
+#include "kls/coroutine/Blocking.h"
+#include "kls/coroutine/Operation.h"
+
+// counts the allocations made by each thread, so the producer side of an append can be measured in isolation
+static thread_local uint64_t allocation_count = 0;
+
+void *operator new(std::size_t size) {
+    ++allocation_count;
+    if (auto ptr = std::malloc(size ? size : 1)) return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+
+TEST(kls_journal, AppendAllocationBench) {
+    using namespace kls;
+    using namespace kls::journal;
+    using namespace kls::coroutine;
+
+    static constexpr auto root = std::string_view("./test.kls.journal.alloc");
+    static constexpr int Records = 50000;
+    // fifteen of them fill a file, so the warm-up reaches file 2 and the measured run rotates once into file 3
+    static constexpr int LargeSize = 256 << 10;
+    static constexpr int WarmUpLarge = 40;
+    static constexpr int MeasuredLarge = 10;
+    static constexpr auto payload = std::string_view("0123456789abcdef");
+
+    auto report = [](std::string_view name, uint64_t allocations, uint64_t batches, auto elapsed) {
+        const auto us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+        std::cout << kls::format("{}: {} allocations in {} batches for {} records in {}us", name, allocations,
+                                 batches, Records, us) << std::endl;
+    };
+
+    auto Run = [&]() -> ValueAsync<bool> {
+        auto append = create_file_journal(root);
+        uint64_t batched{};
+        bool rotated{};
+        co_await uses(append, [&](FileJournal &file) -> ValueAsync<> {
+            const std::string large(size_t(LargeSize), 'l');
+            const auto large_span = Span<char>{std::string_view(large)};
+            {
+                // fill files 0 to 2, then check a checkpoint starting at file 2 so files 0 and 1 become spare files
+                // to be reopened by later rotations
+                AppendFuture last{};
+                for (int i = 0; i < WarmUpLarge; ++i) last = file.append_batched(large_span);
+                for (int i = 0; i < Records; ++i) last = file.append_batched(Span<char>{payload});
+                co_await last;
+                co_await file.register_checkpoint();
+                co_await file.check_checkpoint();
+            }
+            {
+                // only the future of the last record is kept, the others go back to the pool as their batch is written
+                AppendFuture last{};
+                const auto start = std::chrono::steady_clock::now();
+                const auto batches_before = file.statistics().batches;
+                const auto before = allocation_count;
+                for (int i = 0; i < Records; ++i) {
+                    if (i % (Records / MeasuredLarge) == 0) last = file.append_batched(large_span);
+                    last = file.append_batched(Span<char>{payload});
+                }
+                batched = allocation_count - before;
+                report("append_batched", batched, file.statistics().batches - batches_before,
+                       std::chrono::steady_clock::now() - start);
+                co_await last;
+                rotated = std::filesystem::exists(std::filesystem::path(root) / "3.journal");
+            }
+            {
+                std::vector<ValueAsync<>> ops{};
+                ops.reserve(Records);
+                const auto start = std::chrono::steady_clock::now();
+                const auto batches_before = file.statistics().batches;
+                const auto before = allocation_count;
+                for (int i = 0; i < Records; ++i) ops.push_back(file.append(Span<char>{payload}));
+                const auto allocated = allocation_count - before;
+                const auto opened = file.statistics().batches - batches_before;
+                report("append", allocated, opened, std::chrono::steady_clock::now() - start);
+                co_await await_all(std::move(ops));
+            }
+        });
+        // the measured run rotated into a reopened spare file without allocating on the producer side
+        EXPECT_TRUE(rotated);
+        EXPECT_EQ(batched, 0u);
+        co_return rotated && batched == 0;
+    };
+
+    auto success = run_blocking([&]() -> ValueAsync<bool> {
+        try {
+            auto result = co_await Run();
+            std::filesystem::remove_all(root);
+            co_return result;
+        }
+        catch (...) {
+            std::filesystem::remove_all(root);
+            throw;
+        }
+    });
+    ASSERT_TRUE(success);
+}
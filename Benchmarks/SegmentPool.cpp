@@ -0,0 +1,162 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+#include <functional>
+#include <gtest/gtest.h>
+#include "kls/Format.h"
+#include "kls/essential/Memory.h"
+#include "kls/journal/SegmentPool.h"
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+namespace {
+    using namespace kls;
+    using namespace kls::journal;
+
+    static constexpr int Blocks = 8;
+    static constexpr int RecordSize = 64;
+
+    // a pool under measurement, the node is the one of the thread renting the block
+    struct Pool {
+        std::string_view name;
+        std::function<uintptr_t(int)> rent;
+        std::function<void(uintptr_t, int)> release;
+    };
+
+#if defined(__linux__)
+    std::vector<int> node_cpus(int node) {
+        std::vector<int> result{};
+        std::ifstream list(kls::format("/sys/devices/system/node/node{}/cpulist", node));
+        for (std::string range{}; std::getline(list, range, ',');) {
+            const auto dash = range.find('-');
+            const auto first = std::stoi(range.substr(0, dash));
+            const auto last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; ++cpu) result.push_back(cpu);
+        }
+        return result;
+    }
+
+    int node_count() {
+        int count = 0;
+        while (std::filesystem::exists(kls::format("/sys/devices/system/node/node{}", count))) ++count;
+        return count;
+    }
+
+    // restores the affinity of the benchmark thread when the measurement is done
+    struct AffinityGuard {
+        cpu_set_t saved{};
+        AffinityGuard() noexcept { sched_getaffinity(0, sizeof(saved), &saved); }
+        ~AffinityGuard() { sched_setaffinity(0, sizeof(saved), &saved); }
+    };
+
+    bool pin_to_node(int node) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (auto cpu: node_cpus(node)) CPU_SET(cpu, &set);
+        return CPU_COUNT(&set) && sched_setaffinity(0, sizeof(set), &set) == 0;
+    }
+#else
+    struct AffinityGuard {};
+
+    int node_count() { return 1; }
+
+    bool pin_to_node(int) { return false; }
+#endif
+
+    // appends small records through the whole segment the way the journal does, then reads it back in a scattered
+    // order so that every access is likely to need a different page translation
+    uint64_t produce(uintptr_t block) {
+        const auto memory = reinterpret_cast<char *>(block);
+        char record[RecordSize];
+        for (int offset = 0; offset + RecordSize <= SegmentBlockSize; offset += RecordSize) {
+            std::memset(record, offset, RecordSize);
+            std::memcpy(memory + offset, record, RecordSize);
+        }
+        uint64_t checksum{}, state{0x9e3779b97f4a7c15ull};
+        for (int i = 0; i < SegmentBlockSize / RecordSize; ++i) {
+            state = state * 6364136223846793005ull + 1442695040888963407ull;
+            checksum += uint8_t(memory[(state >> 33) % SegmentBlockSize]);
+        }
+        return checksum;
+    }
+
+    int64_t run(const Pool &pool, int node, std::vector<uintptr_t> &blocks, uint64_t &checksum) {
+        const auto start = std::chrono::steady_clock::now();
+        for (auto &block: blocks) checksum += produce(block = pool.rent(node));
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        for (auto block: blocks) pool.release(block, node);
+        return std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+    }
+}
+
+TEST(kls_journal, SegmentPoolBench) {
+    const Pool pools[] = {
+            {
+                    "essential 4m block pool",
+                    [](int) { return essential::rent_4m_block(); },
+                    [](uintptr_t block, int) { essential::return_4m_block(block); }
+            },
+            {
+                    "segment pool",
+                    [](int node) { return rent_segment_block(node); },
+                    [](uintptr_t block, int node) { return_segment_block(block, node); }
+            }
+    };
+    AffinityGuard affinity{};
+    const auto touch_node = 0, producer_node = node_count() > 1 ? 1 : 0;
+    if (touch_node == producer_node)
+        std::cout << "single NUMA node, segments are touched and produced into on the same node" << std::endl;
+    const auto before = segment_pool_statistics();
+    for (auto &&pool: pools) {
+        std::vector<uintptr_t> blocks(Blocks);
+        uint64_t checksum{};
+        // the segments are first touched on one node, as if a producer on that node had used them before
+        const auto pinned = pin_to_node(touch_node);
+        for (auto &block: blocks) block = pool.rent(touch_node);
+        for (auto block: blocks) std::memset(reinterpret_cast<void *>(block), 0, SegmentBlockSize);
+        for (auto block: blocks) pool.release(block, touch_node);
+        // then a producer on the other node rents segments, the first time and again after releasing them
+        pin_to_node(producer_node);
+        const auto first_us = run(pool, producer_node, blocks, checksum);
+        const auto reused_us = run(pool, producer_node, blocks, checksum);
+        EXPECT_NE(checksum, 0u);
+        std::cout << kls::format(
+                "{}: touched on node {}{}, produced on node {}, {} segments: first rent {}us, reused {}us",
+                pool.name, touch_node, pinned ? "" : " (unpinned)", producer_node, Blocks, first_us, reused_us
+        ) << std::endl;
+    }
+    const auto after = segment_pool_statistics();
+    std::cout << kls::format(
+            "segment pool mappings: {} explicit huge, {} transparent huge, {} regular, {} not bound to their node",
+            after.explicit_huge - before.explicit_huge, after.transparent_huge - before.transparent_huge,
+            after.regular - before.regular, after.unbound - before.unbound
+    ) << std::endl;
+}
@@ -0,0 +1,155 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <new>
+#include <array>
+#include <mutex>
+#include <atomic>
+#include "kls/thread/SpinLock.h"
+#include "kls/essential/Memory.h"
+#include "kls/journal/SegmentPool.h"
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+
+namespace kls::journal {
+    static constexpr int MaxNodes = 64;
+    // caps the idle memory kept by the pool at 32MiB per node, blocks released beyond that are unmapped right away
+    static constexpr int MaxPooledBlocks = 8;
+
+    // how the blocks have been mapped, reported by segment_pool_statistics
+    static std::atomic_uint64_t explicit_huge_blocks{0}, transparent_huge_blocks{0};
+    static std::atomic_uint64_t regular_blocks{0}, unbound_blocks{0};
+
+#if defined(__linux__)
+    static constexpr uintptr_t HugePageSize = 2 << 20;
+
+    static void bind_to_node(void *address, int node) noexcept {
+        // preferred instead of bind, so a full node degrades to remote memory instead of failing the page fault
+        if (node >= 0 && node < MaxNodes) {
+            unsigned long mask = 1ul << node;
+            if (syscall(SYS_mbind, address, SegmentBlockSize, MPOL_PREFERRED, &mask, MaxNodes + 1, 0) == 0) return;
+        }
+        unbound_blocks.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static uintptr_t map_block(int node) noexcept {
+        constexpr auto prot = PROT_READ | PROT_WRITE;
+        constexpr auto flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+        // explicit huge pages only exist if they have been reserved on the host, so they may well be unavailable
+        constexpr auto huge_flags = flags | MAP_HUGETLB | (21 << MAP_HUGE_SHIFT);
+        if (auto huge = mmap(nullptr, SegmentBlockSize, prot, huge_flags, -1, 0); huge != MAP_FAILED) {
+            explicit_huge_blocks.fetch_add(1, std::memory_order_relaxed);
+            return bind_to_node(huge, node), uintptr_t(huge);
+        }
+#endif
+        // otherwise over-map to carve out a 2MiB aligned region and ask for transparent huge pages on it
+        constexpr auto mapped_size = SegmentBlockSize + HugePageSize;
+        const auto raw = mmap(nullptr, mapped_size, prot, flags, -1, 0);
+        if (raw == MAP_FAILED) return 0;
+        const auto base = uintptr_t(raw), aligned = (base + HugePageSize - 1) & ~(HugePageSize - 1);
+        const auto end = aligned + SegmentBlockSize;
+        if (aligned != base) munmap(raw, aligned - base);
+        if (end != base + mapped_size) munmap(reinterpret_cast<void *>(end), base + mapped_size - end);
+#if defined(MADV_HUGEPAGE)
+        if (madvise(reinterpret_cast<void *>(aligned), SegmentBlockSize, MADV_HUGEPAGE) == 0)
+            transparent_huge_blocks.fetch_add(1, std::memory_order_relaxed);
+        else
+            regular_blocks.fetch_add(1, std::memory_order_relaxed);
+#else
+        regular_blocks.fetch_add(1, std::memory_order_relaxed);
+#endif
+        return bind_to_node(reinterpret_cast<void *>(aligned), node), aligned;
+    }
+
+    static void unmap_block(uintptr_t block) noexcept { munmap(reinterpret_cast<void *>(block), SegmentBlockSize); }
+
+    int current_numa_node() noexcept {
+        unsigned cpu{}, node{};
+        if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) return 0;
+        return node < MaxNodes ? int(node) : 0;
+    }
+#else
+    static uintptr_t map_block(int) noexcept {
+        regular_blocks.fetch_add(1, std::memory_order_relaxed);
+        unbound_blocks.fetch_add(1, std::memory_order_relaxed);
+        return essential::rent_4m_block();
+    }
+
+    static void unmap_block(uintptr_t block) noexcept { essential::return_4m_block(block); }
+
+    int current_numa_node() noexcept { return 0; }
+#endif
+
+    class SegmentPool {
+    public:
+        uintptr_t rent(int node) {
+            {
+                auto &list = m_nodes[slot(node)];
+                std::lock_guard lk{list.lock};
+                if (list.count) return list.blocks[--list.count];
+            }
+            if (auto block = map_block(node)) return block;
+            throw std::bad_alloc();
+        }
+
+        void release(uintptr_t block, int node) noexcept {
+            {
+                auto &list = m_nodes[slot(node)];
+                std::lock_guard lk{list.lock};
+                if (list.count < MaxPooledBlocks) return void(list.blocks[list.count++] = block);
+            }
+            unmap_block(block);
+        }
+
+        // the pool is intentionally never destroyed, so that buffers released during static destruction are safe
+        static SegmentPool &get() noexcept {
+            static auto &instance = *new SegmentPool();
+            return instance;
+        }
+    private:
+        struct NodeList {
+            thread::SpinLock lock{};
+            int count{0};
+            std::array<uintptr_t, MaxPooledBlocks> blocks{};
+        };
+        std::array<NodeList, MaxNodes> m_nodes{};
+
+        static int slot(int node) noexcept { return (node >= 0 && node < MaxNodes) ? node : 0; }
+    };
+
+    uintptr_t rent_segment_block(int node) { return SegmentPool::get().rent(node); }
+
+    void return_segment_block(uintptr_t block, int node) noexcept { SegmentPool::get().release(block, node); }
+
+    SegmentPoolStatistics segment_pool_statistics() noexcept {
+        return {
+                .explicit_huge = explicit_huge_blocks.load(), .transparent_huge = transparent_huge_blocks.load(),
+                .regular = regular_blocks.load(), .unbound = unbound_blocks.load()
+        };
+    }
+}
@@ -30,38 +30,93 @@
 namespace kls::journal::rotating_file::detail {
     static constexpr auto FileOption = io::Block::F_CREAT | io::Block::F_WRITE;
 
-    static LazyFile open_file(const fs::path &base, uint64_t id) {
+    static coroutine::ValueAsync<SafeHandle<io::Block>> open_file(const fs::path &base, uint64_t id) {
         auto path = base / kls::format("{}{}", id, FileExtension);
         auto path_string = path.generic_string();
         auto handle = co_await io::Block::open(path_string, FileOption);
         co_return std::move(handle);
     }
 
-    ActiveFile::ActiveFile(const fs::path &base, uint64_t id) : m_file(open_file(base, id)), m_buffer{} {}
+    // parks the batch writer until there is something for it to do, the waking side resumes it
+    struct ActiveFile::Park {
+        ActiveFile &file;
+        [[nodiscard]] bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> handle) noexcept {
+            std::lock_guard lk{file.m_sequence};
+            if (file.writer_ready()) return false;
+            file.m_batch_writer_stage = BS_NONE;
+            file.m_parked = handle;
+            return true;
+        }
+        void await_resume() const noexcept {}
+    };
+
+    ActiveFile::ActiveFile(const fs::path &base, uint64_t id, std::atomic_uint64_t &batches, CompletionPool &pool) :
+            m_base(base), m_id(id), m_buffer{}, m_pool(pool), m_batches(batches), m_closed(pool.rent()),
+            m_writer(batch_writer()) {}
+
+    ActiveFile::~ActiveFile() { m_closed->release(); }
+
+    AppendFuture ActiveFile::close() {
+        // no allocation can succeed after this, so the last allocated offset is where the file ends
+        const auto sealed = m_allocation_offset.exchange(MaxFileSize + 1);
+        std::coroutine_handle<> parked{};
+        {
+            std::lock_guard lk{m_sequence};
+            m_sealed = sealed, m_closing = true;
+            if (writer_ready()) parked = std::exchange(m_parked, {});
+        }
+        if (parked) parked.resume();
+        return closed();
+    }
+
+    AppendFuture ActiveFile::closed() {
+        std::lock_guard lk{m_sequence};
+        return AppendFuture(m_closed);
+    }
+
+    void ActiveFile::reset(uint64_t id) {
+        std::lock_guard lk{m_sequence};
+        m_id = id;
+        m_batch_offset = m_file_offset = m_sealed = 0;
+        m_error = nullptr;
+        std::exchange(m_closed, m_pool.rent())->release();
+        m_commit_offset.store(0);
+        m_allocation_offset.store(0);
+    }
 
-    coroutine::ValueAsync<> ActiveFile::close() {
-        if (m_last_writer) co_await std::move(m_last_writer);
-        co_await ((co_await m_file)->close());
+    coroutine::ValueAsync<> ActiveFile::shutdown() {
+        std::coroutine_handle<> parked{};
+        {
+            std::lock_guard lk{m_sequence};
+            m_shutdown = true;
+            parked = std::exchange(m_parked, {});
+        }
+        if (parked) parked.resume();
+        co_await std::move(m_writer);
     }
 
-    std::optional<coroutine::FlexFuture<>> ActiveFile::append(int8_t type, Span<> record) {
+    std::optional<AppendFuture> ActiveFile::append(int8_t type, Span<> prefix, Span<> record) {
         // try to allocate space for the commit operation, return nullopt on failure
         // since we need the allocation counter to correctly close the file, we need to do CAS
+        auto prefix_view = static_span_cast<char>(prefix);
         auto record_view = static_span_cast<char>(record);
+        const auto body_size = int32_t(prefix_view.size() + record_view.size());
         int32_t allocation{}, end_offset{};
         for (;;) {
             allocation = m_allocation_offset.load();
-            end_offset = allocation + int32_t(record.size()) + 4;
+            end_offset = allocation + body_size + 4;
             if (end_offset > MaxFileSize) return std::nullopt;
             if (m_allocation_offset.compare_exchange_weak(allocation, end_offset)) break;
         }
         // trim the buffer to get the allocated segment as a span
         auto buffer_view = static_span_cast<char>(m_buffer.span()).trim_front(allocation);
         // write the message header
-        const auto header = uint32_t(record_view.size()) << uint32_t(8) | uint32_t(type);
+        const auto header = uint32_t(body_size) << uint32_t(8) | uint32_t(type);
         essential::Access<endian>(buffer_view).put<uint32_t>(0, header);
         // allocation is set, copy to buffer does not require synchronization
-        std::ranges::copy(record_view, buffer_view.trim_front(4).begin());
+        auto body_out = std::ranges::copy(prefix_view, buffer_view.trim_front(4).begin()).out;
+        std::ranges::copy(record_view, body_out);
         // sequencing for the commit operation
         // as 1MiB max memcpy should not take much time, we can simply spin-wait
         thread::SpinWait wait{};
@@ -74,58 +129,73 @@ namespace kls::journal::rotating_file::detail {
             wait.once();
         }
         // batched update
-        std::lock_guard lk{m_sequence};
-        // update the batch offset so the writer knows there is more work
-        // as this lock can be taken out of order, we need to sequence again
-        // however, since anything before end_offset is guaranteed to have finished copying by the last sequencing,
-        // we can simply only update the batch writer's offset if the end_offset is larger
-        if (m_batch_offset < end_offset) m_batch_offset = end_offset;
-        // observer based on the stage
-        switch (m_batch_writer_stage) {
-            case BS_NONE:
-                batch_writer();
-                [[fallthrough]];
-            case BS_LIVE:
-                std::construct_at(&m_future.value, [this](auto h) noexcept { m_promise = std::move(h); });
+        std::optional<AppendFuture> future{};
+        std::coroutine_handle<> parked{};
+        {
+            std::lock_guard lk{m_sequence};
+            // update the batch offset so the writer knows there is more work
+            // as this lock can be taken out of order, we need to sequence again
+            // however, since anything before end_offset is guaranteed to have finished copying by the last sequencing,
+            // we can simply only update the batch writer's offset if the end_offset is larger
+            if (m_batch_offset < end_offset) m_batch_offset = end_offset;
+            // open a new batch with a completion from the pool if the writer has taken the last one, and wake the
+            // writer if it is parked. for BS_PENDING nothing need to be done
+            if (m_batch_writer_stage != BS_PENDING) {
+                m_completion = m_pool.rent();
                 m_batch_writer_stage = BS_PENDING;
-                [[fallthrough]];
-            default:
-                break; // for BS_PENDING nothing need to be done
+                m_batches.fetch_add(1, std::memory_order_relaxed);
+                parked = std::exchange(m_parked, {});
+            }
+            future.emplace(m_completion);
         }
-        return std::optional{m_future.value};
+        // the writer redispatches right away, so the producer only pays for the resumption
+        if (parked) parked.resume();
+        return future;
     }
 
-    void ActiveFile::batch_writer() { m_last_writer = batch_writer_work(std::move(m_last_writer)); }
+    bool ActiveFile::writer_ready() const noexcept {
+        if (m_shutdown || m_batch_writer_stage == BS_PENDING) return true;
+        return m_closing && m_batch_offset == m_sealed;
+    }
 
-    coroutine::ValueAsync<> ActiveFile::batch_writer_work(coroutine::ValueAsync<> last) {
-        auto &file = co_await m_file;
-        co_await coroutine::Redispatch{};
-        {
+    coroutine::ValueAsync<> ActiveFile::batch_writer() {
+        for (;;) {
+            co_await Park{*this};
+            if (m_shutdown) co_return;
+            co_await coroutine::Redispatch{};
             std::unique_lock lk{m_sequence};
-            for (;;) {
-                auto promise = batch_writer_live();
-                int32_t start_offset = m_file_offset, end_offset = m_batch_offset;
+            while (m_batch_writer_stage == BS_PENDING) {
+                m_batch_writer_stage = BS_LIVE;
+                const auto completion = std::exchange(m_completion, nullptr);
+                const int32_t start_offset = m_file_offset, end_offset = m_batch_offset;
                 lk.unlock();
+                // the file is opened on the first batch, and once a batch fails, every later batch fails the same way
                 try {
+                    if (m_error) std::rethrow_exception(m_error);
+                    if (!m_file) m_file.emplace(co_await open_file(m_base, m_id));
                     auto batched_span = m_buffer.span().keep_front(end_offset).trim_front(start_offset);
-                    (co_await file->write(batched_span, start_offset)).get_result(), promise->set();
+                    (co_await (*m_file)->write(batched_span, start_offset)).get_result(), completion->set();
                 }
-                catch (...) { promise->fail(std::current_exception()); }
-                lk.lock();
-                if (m_batch_writer_stage != BS_PENDING) {
-                    m_batch_writer_stage = BS_NONE;
-                    break;
+                catch (...) {
+                    m_error = std::current_exception();
+                    completion->fail(m_error);
                 }
+                completion->release();
+                lk.lock();
+                m_file_offset = end_offset;
             }
+            // everything before the sealed offset is written, so the file can be closed
+            if (!m_closing || m_batch_offset != m_sealed) continue;
+            const auto closed = m_closed;
+            m_closing = false;
+            lk.unlock();
+            std::exception_ptr error{};
+            try {
+                if (m_file) co_await (*m_file)->close();
+            }
+            catch (...) { error = std::current_exception(); }
+            m_file.reset();
+            if (error) closed->fail(std::move(error)); else closed->set();
         }
-        if (last) co_await std::move(last); // consume the future for the last writer to minimize blocking
-    }
-
-    coroutine::FlexFuture<>::PromiseHandle ActiveFile::batch_writer_live() {
-        // set stage to LIVE if it has not been
-        if (m_batch_writer_stage != BS_LIVE) m_batch_writer_stage = BS_LIVE;
-        // destroy the current shared future and get the current promise
-        std::destroy_at(&m_future.value);
-        return std::move(m_promise);
     }
-}
\ No newline at end of file
+}
@@ -27,16 +27,26 @@
 #include "kls/io/Block.h"
 
 namespace kls::journal::rotating_file::detail {
-    using LazyFile = coroutine::LazyAsync<SafeHandle<io::Block>>;
-
     class ActiveFile : public AddressSensitive {
     public:
-        explicit ActiveFile(const fs::path &base, std::uint64_t id);
-        std::optional<coroutine::FlexFuture<>> append(int8_t type, Span<> record);
-        coroutine::ValueAsync<> close();
+        explicit ActiveFile(
+                const fs::path &base, std::uint64_t id, std::atomic_uint64_t &batches, CompletionPool &pool
+        );
+        ~ActiveFile();
+        std::optional<AppendFuture> append(int8_t type, Span<> prefix, Span<> record);
+        // seals the file, the returned future completes once everything appended is written and the file is closed
+        AppendFuture close();
+        [[nodiscard]] AppendFuture closed();
+        // reopens a closed file under a new id, keeping its buffer and its batch writer
+        void reset(std::uint64_t id);
+        // stops the batch writer, only to be called once the file is closed
+        coroutine::ValueAsync<> shutdown();
     private:
-        LazyFile m_file;
+        const fs::path &m_base;
+        std::uint64_t m_id;
         Buffer m_buffer;
+        CompletionPool &m_pool;
+        std::atomic_uint64_t &m_batches;
         // insert operation helper
         std::atomic_int32_t m_allocation_offset{0}, m_commit_offset{0};
         // batch writer states
@@ -45,14 +55,17 @@ namespace kls::journal::rotating_file::detail {
         };
         thread::SpinLock m_sequence{}; // this lock protect everything below
         BatchStage m_batch_writer_stage{BS_NONE};
-        int32_t m_batch_offset{0}, m_file_offset{0};
-        Storage<coroutine::FlexFuture<>> m_future{};
-        coroutine::FlexFuture<>::PromiseHandle m_promise{};
+        int32_t m_batch_offset{0}, m_file_offset{0}, m_sealed{0};
+        bool m_closing{false}, m_shutdown{false};
+        AppendCompletion *m_completion{nullptr}, *m_closed;
+        std::coroutine_handle<> m_parked{};
 
-        // The batch writer and its future
-        void batch_writer();
-        coroutine::ValueAsync<> m_last_writer{};
-        coroutine::FlexFuture<>::PromiseHandle batch_writer_live();
-        coroutine::ValueAsync<> batch_writer_work(coroutine::ValueAsync<> last);
+        // The batch writer, owned by the writer only
+        struct Park;
+        std::exception_ptr m_error{};
+        std::optional<SafeHandle<io::Block>> m_file{};
+        coroutine::ValueAsync<> m_writer;
+        [[nodiscard]] bool writer_ready() const noexcept;
+        coroutine::ValueAsync<> batch_writer();
     };
-}
\ No newline at end of file
+}
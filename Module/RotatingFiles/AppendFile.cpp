@@ -25,26 +25,33 @@
 #include "kls/Format.h"
 
 namespace kls::journal::rotating_file::detail {
-    AppendFile::AppendFile(fs::path &base, std::uint64_t id) :
-            m_base(base), m_id(id), m_active(std::make_shared<ActiveFile>(base, id)) {}
-
-    std::optional<coroutine::FlexFuture<>> AppendFile::append(int8_t type, Span<> record) {
-        if (m_state == S_ACTIVE) {
-            const auto active = static_cast<ActiveFile *>(m_active.get());
-            return active->append(type, record);
-        }
+    AppendFile::AppendFile(fs::path &base, std::uint64_t id, std::atomic_uint64_t &batches, CompletionPool &pool) :
+            m_base(base), m_id(id), m_active(std::make_unique<ActiveFile>(base, id, batches, pool)) {}
+
+    AppendFile::~AppendFile() = default;
+
+    std::optional<AppendFuture> AppendFile::append(int8_t type, Span<> prefix, Span<> record) {
+        if (m_state == S_ACTIVE) return m_active->append(type, prefix, record);
         return std::nullopt;
     }
 
-    coroutine::ValueAsync<> AppendFile::close() {
-        if (m_state != S_ACTIVE) return []() -> coroutine::ValueAsync<> { co_return; }(); else m_state = S_STUB;
-        auto handle = std::static_pointer_cast<ActiveFile>(std::move(m_active));
-        auto fn_close = [](std::shared_ptr<ActiveFile> handle) -> coroutine::ValueAsync<> { co_await handle->close(); };
-        return fn_close(std::move(handle));
+    void AppendFile::close() {
+        if (m_state != S_ACTIVE) return; else m_state = S_STUB;
+        (void) m_active->close();
     }
 
+    AppendFuture AppendFile::closed() { return m_active->closed(); }
+
     void AppendFile::remove() {
         if (m_state != S_STUB) throw std::logic_error("invalid state"); else m_state = S_REMOVED;
-        fs::remove(m_base / kls::format("{}.{}", m_id, FileExtension));
+        fs::remove(m_base / kls::format("{}{}", m_id, FileExtension));
     }
-}
\ No newline at end of file
+
+    void AppendFile::reopen(std::uint64_t id) {
+        if (m_state != S_REMOVED) throw std::logic_error("invalid state"); else m_state = S_ACTIVE;
+        m_id = id;
+        m_active->reset(id);
+    }
+
+    coroutine::ValueAsync<> AppendFile::shutdown() { return m_active->shutdown(); }
+}
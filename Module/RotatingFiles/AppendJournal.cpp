@@ -25,9 +25,12 @@
 #include "Common.h"
 #include "kls/Format.h"
 #include "kls/essential/Unsafe.h"
-#include "kls/coroutine/Operation.h"
 
 static constexpr auto err_non_empty = "given path for appending journal is not empty: {}";
+static constexpr auto err_too_large = "journal record size too large";
+static constexpr auto err_empty_record = "journal record is empty";
+static constexpr auto err_no_stream = "journal record stream is not open";
+static constexpr auto err_overrun = "journal record chunk exceeds the size of the record";
 
 namespace kls::journal::rotating_file::detail {
     struct CheckRecord {
@@ -40,80 +43,178 @@ namespace kls::journal::rotating_file::detail {
         Span<> span() & noexcept { return {buffer, 16}; }
     };
 
+    struct FragmentHeader {
+        char buffer[FragmentBeginHeaderSize]{};
+        int32_t size;
+        explicit FragmentHeader(uint64_t stream) noexcept: size(FragmentHeaderSize) {
+            essential::Access<endian>{{buffer, size}}.put(0, stream);
+        }
+        FragmentHeader(uint64_t stream, uint64_t total) noexcept: size(FragmentBeginHeaderSize) {
+            essential::Access<endian> access{{buffer, size}};
+            access.put(0, stream);
+            access.put(8, total);
+        }
+        Span<> span() & noexcept { return {buffer, size}; }
+    };
+
     AppendJournal::AppendJournal(const fs::path &base) : m_base(prepare_path(base)) {
         if (auto&&[a, b] = scan_files(base); a || b)
             throw std::runtime_error(kls::format(err_non_empty, base.generic_string()));
     }
 
+    // the only frame of an append that is not batched
+    static coroutine::ValueAsync<> await_append(AppendFuture future) { co_await future; }
+
     coroutine::ValueAsync<> AppendJournal::append(Span<> record) {
-        if (record.size() + 4 > MaxRecordSize) throw std::runtime_error("journal record size too large");
+        if (record.size() + 4 > MaxRecordSize) return append_chunk(begin_record(record.size()), record);
         m_lock.lock();
-        return append_internal(RTypeData, record);
+        return await_append(append_internal(RTypeData, {}, record));
     }
 
-    coroutine::ValueAsync<> AppendJournal::append_internal(int8_t type, Span<> record) {
+    AppendFuture AppendJournal::append_batched(Span<> record) {
+        if (record.size() + 4 > MaxRecordSize) throw std::runtime_error(err_too_large);
+        m_lock.lock();
+        return append_internal(RTypeData, {}, record);
+    }
+
+    uint64_t AppendJournal::begin_record(uint64_t size) {
+        if (!size) throw std::runtime_error(err_empty_record);
+        std::lock_guard lk{m_lock};
+        const auto stream = m_next_stream++;
+        const auto first_file = m_files.empty() ? m_next_file : m_files.back().id();
+        m_streams[stream] = Stream{.first_file = first_file, .size = size, .written = 0};
+        return stream;
+    }
+
+    coroutine::ValueAsync<> AppendJournal::append_chunk(uint64_t stream, Span<> chunk) {
+        static constexpr int64_t BeginChunk = MaxRecordSize - 4 - FragmentBeginHeaderSize;
+        static constexpr int64_t NextChunk = MaxRecordSize - 4 - FragmentHeaderSize;
+        // every fragment takes the lock on its own, so other producers can interleave with a large record
+        // all the copying is done before the first suspension, so the caller may drop the chunk once this returns
+        auto rest = static_span_cast<char>(chunk);
+        std::vector<AppendFuture> ops{};
+        ops.reserve(size_t(rest.size() / NextChunk + 2));
+        // once the end fragment has its space allocated, or the record failed to append, later checkpoints no longer
+        // need to hold the first file. the partial record left by a failure is dropped by recovery as it has no end
+        auto release_stream = [this, stream]() {
+            std::lock_guard lk{m_lock};
+            m_streams.erase(stream);
+        };
+        {
+            std::lock_guard lk{m_lock};
+            const auto it = m_streams.find(stream);
+            if (it == m_streams.end()) throw std::runtime_error(err_no_stream);
+            if (it->second.size - it->second.written < uint64_t(rest.size())) throw std::runtime_error(err_overrun);
+        }
+        try {
+            while (rest.size()) {
+                std::unique_lock lk{m_lock};
+                auto &state = m_streams.find(stream)->second;
+                const auto open = state.written == 0;
+                const auto take = std::min<int64_t>(rest.size(), open ? BeginChunk : NextChunk);
+                const auto end = (state.written += take) == state.size;
+                const auto type = open ? RTypeBegin : (end ? RTypeEnd : RTypeContinue);
+                auto header = open ? FragmentHeader(stream, state.size) : FragmentHeader(stream);
+                ops.push_back((lk.release(), append_internal(type, header.span(), rest.keep_front(take))));
+                rest = rest.trim_front(take);
+                if (!end) continue;
+                // a record fitting in its begin fragment still needs an end fragment to be complete
+                if (open) {
+                    auto next = FragmentHeader(stream);
+                    m_lock.lock();
+                    ops.push_back(append_internal(RTypeEnd, next.span(), {}));
+                }
+                release_stream();
+            }
+        }
+        catch (...) {
+            release_stream();
+            throw;
+        }
+        for (auto &&op: ops) co_await op;
+    }
+
+    AppendFuture AppendJournal::append_internal(int8_t type, Span<> prefix, Span<> record) {
         std::unique_lock lk{m_lock, std::adopt_lock};
         m_segment_empty = false;
-        coroutine::ValueAsync<> to_close{};
         for (;;) {
             if (m_files.empty()) break;
             auto file = &m_files.back();
-            if (auto opt = (lk.unlock(), file->append(type, record)); opt) return coroutine::awaits(*std::move(opt));
+            auto opt = (lk.unlock(), file->append(type, prefix, record));
+            if (opt) return *std::move(opt);
             lk.lock();
             if (file->id() == m_files.back().id()) {
-                to_close = file->close();
+                file->close();
                 break;
             }
         }
-        m_files.emplace_back(m_base, m_next_file++);
-        auto &file = m_files.back();
+        auto &file = next_file();
         auto hint = CheckRecord(get_last_checkpoint(), get_current_checkpoint());
         lk.unlock();
-        auto commit_hint = *file.append(RTypeCheck, hint.span());
-        auto commit_record = *file.append(type, record);
-        if (to_close)
-            return coroutine::awaits(std::move(to_close), std::move(commit_hint), std::move(commit_record));
-        else
-            return coroutine::awaits(std::move(commit_hint), std::move(commit_record));
+        // the record is written after the hint by the same batch writer, so its future covers the hint
+        (void) file.append(RTypeCheck, {}, hint.span());
+        return *file.append(type, prefix, record);
+    }
+
+    AppendFile &AppendJournal::next_file() {
+        if (m_spare_files.empty()) return m_files.emplace_back(m_base, m_next_file++, m_batches, *m_pool);
+        m_files.splice(m_files.end(), m_spare_files, m_spare_files.begin());
+        m_files.back().reopen(m_next_file++);
+        return m_files.back();
     }
 
     coroutine::ValueAsync<uint64_t> AppendJournal::register_checkpoint() {
         std::unique_lock lk{m_lock};
         if (m_segment_empty) co_return get_current_checkpoint(); else m_segment_empty = true;
-        m_checkpoints[m_next_checkpoint++] = m_files.back().id();
+        // a fragmented record still being appended holds the segment start back to the file of its first fragment
+        m_checkpoints[m_next_checkpoint++] = get_segment_start();
         auto current_checkpoint = get_current_checkpoint();
         auto record = CheckRecord(get_last_checkpoint(), current_checkpoint);
-        co_await (lk.release(), append_internal(RTypeCheck, record.span()));
+        co_await (lk.release(), append_internal(RTypeCheck, {}, record.span()));
         co_return current_checkpoint;
     }
 
     coroutine::ValueAsync<> AppendJournal::check_checkpoint() {
         std::unique_lock lk{m_lock};
         auto last_keep_id = m_checkpoints.begin()->second;
-        while (!m_files.empty()) {
-            auto &file = m_files.front();
-            if (file.id() >= last_keep_id) break;
-            // as there is only one "active" file, there is no worry to remove a not-closed file
-            m_files.front().remove();
-            m_files.erase(m_files.begin());
-        }
+        std::list<AppendFile> removed{};
+        // every file but the last is closed on rotation, so all the removed files are going to be closed
+        while (!m_files.empty() && m_files.front().id() < last_keep_id)
+            removed.splice(removed.end(), m_files, m_files.begin());
         m_checkpoints.erase(m_checkpoints.begin());
         auto record = CheckRecord(get_last_checkpoint(), get_current_checkpoint());
-        co_await (lk.release(), append_internal(RTypeCheck, record.span()));
+        auto commit = (lk.release(), append_internal(RTypeCheck, {}, record.span()));
+        // a file is removed once it has been fully written, after which it can be reused for a later rotation
+        std::exception_ptr error{};
+        for (auto &&file: removed) {
+            try { co_await file.closed(); } catch (...) { error = std::current_exception(); }
+            file.remove();
+        }
+        {
+            std::lock_guard spare_lk{m_lock};
+            m_spare_files.splice(m_spare_files.end(), removed);
+            while (m_spare_files.size() > MaxSpareFiles)
+                removed.splice(removed.end(), m_spare_files, m_spare_files.begin());
+        }
+        for (auto &&file: removed) co_await file.shutdown();
+        co_await commit;
+        if (error) std::rethrow_exception(error);
     }
 
     coroutine::ValueAsync<> AppendJournal::close() {
         // there is no need to clear the files, as it could be a graceful shutdown due to a failed dependent service
         // we just close every single file in the chain, without synchronization
-        std::vector<coroutine::ValueAsync<>> ops{};
-        ops.reserve(m_files.size());
-        for (auto&& x : m_files) ops.push_back(x.close());
-        co_await coroutine::await_all(std::move(ops));
+        std::exception_ptr error{};
+        for (auto &&x: m_files) x.close();
+        for (auto &&x: m_files) try { co_await x.closed(); } catch (...) { error = std::current_exception(); }
+        for (auto &&x: m_files) co_await x.shutdown();
+        for (auto &&x: m_spare_files) co_await x.shutdown();
+        if (error) std::rethrow_exception(error);
     }
 }
 
 namespace kls::journal {
-    std::shared_ptr<AppendJournal> create_file_journal(std::string_view path) {
+    std::shared_ptr<FileJournal> create_file_journal(std::string_view path) {
         return std::make_shared<rotating_file::detail::AppendJournal>(std::filesystem::path(path));
     }
 }
\ No newline at end of file
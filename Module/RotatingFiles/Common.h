@@ -25,12 +25,17 @@
 #include <bit>
 #include <map>
 #include <list>
+#include <memory>
+#include <atomic>
 #include <cstdint>
+#include <optional>
+#include <algorithm>
 #include <filesystem>
 #include <string_view>
+#include "Completion.h"
 #include "kls/thread/SpinLock.h"
 #include "kls/journal/Journal.h"
-#include "kls/coroutine/Future.h"
+#include "kls/journal/SegmentPool.h"
 
 namespace kls::journal::rotating_file::detail {
     namespace fs = std::filesystem;
@@ -40,61 +45,96 @@ namespace kls::journal::rotating_file::detail {
     static constexpr int32_t MaxFileSize = 4 << 20;
     static constexpr int32_t MaxRecordSize = 1 << 20;
     static constexpr std::string_view FileExtension = ".journal";
+    static_assert(MaxFileSize == SegmentBlockSize);
 
     static constexpr int8_t RTypeData = 0;
     static constexpr int8_t RTypeCheck = 1;
+    static constexpr int8_t RTypeBegin = 2;
+    static constexpr int8_t RTypeContinue = 3;
+    static constexpr int8_t RTypeEnd = 4;
 
+    // fragments carry the 64-bit stream id in front of the chunk, the begin fragment also carries the total size
+    static constexpr int32_t FragmentHeaderSize = 8;
+    static constexpr int32_t FragmentBeginHeaderSize = 16;
+
+    // segment buffer placed on the NUMA node of the thread constructing it, which is the producer triggering rotation
     class Buffer {
     public:
         Buffer() = default;
-        Buffer(Buffer &&o) noexcept: m_b(o.m_b) { o.m_b = 0; }
-        Buffer &operator=(Buffer &&o) noexcept { return (std::swap(m_b, o.m_b), *this); }
-        ~Buffer() { if (m_b) essential::return_4m_block(m_b); }
+        Buffer(Buffer &&o) noexcept: m_node(o.m_node), m_b(o.m_b) { o.m_b = 0; }
+        Buffer &operator=(Buffer &&o) noexcept { return (std::swap(m_node, o.m_node), std::swap(m_b, o.m_b), *this); }
+        ~Buffer() { if (m_b) return_segment_block(m_b, m_node); }
         [[nodiscard]] Span<> span() const noexcept { return {reinterpret_cast<void *>(m_b), MaxFileSize}; }
     private:
-        uintptr_t m_b = essential::rent_4m_block();
+        int m_node = current_numa_node();
+        uintptr_t m_b = rent_segment_block(m_node);
     };
 
+    class ActiveFile;
+
     // File Main Interface
     class AppendFile {
     public:
         enum State {
             S_ACTIVE, // file active for append
             S_STUB, // file not open, can be only removed
-            S_REMOVED // the file is removed
+            S_REMOVED // the file is removed, can be reopened under a new id
         };
-        explicit AppendFile(fs::path &base, std::uint64_t id);
+        explicit AppendFile(fs::path &base, std::uint64_t id, std::atomic_uint64_t &batches, CompletionPool &pool);
+        ~AppendFile();
         [[nodiscard]] uint64_t id() const noexcept { return m_id; }
-        [[nodiscard]] std::optional<coroutine::FlexFuture<>> append(int8_t type, Span<> record);
-        [[nodiscard]] coroutine::ValueAsync<> close();
+        [[nodiscard]] std::optional<AppendFuture> append(int8_t type, Span<> prefix, Span<> record);
+        void close();
+        [[nodiscard]] AppendFuture closed();
         void remove();
+        void reopen(std::uint64_t id);
+        [[nodiscard]] coroutine::ValueAsync<> shutdown();
     private:
         fs::path &m_base;
         std::uint64_t m_id;
         State m_state{S_ACTIVE};
-        std::shared_ptr<void> m_active;
+        std::unique_ptr<ActiveFile> m_active;
     };
 
-    class AppendJournal : public kls::journal::AppendJournal {
+    class AppendJournal : public kls::journal::FileJournal {
     public:
         explicit AppendJournal(const fs::path &base);
         [[nodiscard]] coroutine::ValueAsync<> append(Span<> record) override;
+        [[nodiscard]] AppendFuture append_batched(Span<> record) override;
         [[nodiscard]] coroutine::ValueAsync<uint64_t> register_checkpoint() override;
         [[nodiscard]] coroutine::ValueAsync<> check_checkpoint() override;
         [[nodiscard]] coroutine::ValueAsync<> close() override;
+        [[nodiscard]] uint64_t begin_record(uint64_t size) override;
+        [[nodiscard]] coroutine::ValueAsync<> append_chunk(uint64_t stream, Span<> chunk) override;
+        [[nodiscard]] AppendStatistics statistics() const noexcept override { return {.batches = m_batches.load()}; }
     private:
+        struct Stream {
+            uint64_t first_file, size, written;
+        };
+
+        // removed files kept to be reopened on rotation, with their buffers and batch writers
+        static constexpr size_t MaxSpareFiles = 2;
+
         fs::path m_base;
         thread::SpinLock m_lock;
         bool m_segment_empty{true};
-        std::list<AppendFile> m_files;
+        std::atomic_uint64_t m_batches{0};
+        CompletionPool::Handle m_pool{CompletionPool::create()};
+        std::list<AppendFile> m_files, m_spare_files;
         std::map<uint64_t, uint64_t> m_checkpoints;
-        uint64_t m_next_file{0}, m_next_checkpoint{0};
+        std::map<uint64_t, Stream> m_streams; // fragmented records being appended
+        uint64_t m_next_file{0}, m_next_checkpoint{0}, m_next_stream{0};
 
         uint64_t get_last_checkpoint() const noexcept {
             if (m_checkpoints.empty()) return get_current_checkpoint(); else return m_checkpoints.begin()->first;
         }
         uint64_t get_current_checkpoint() const noexcept { return m_next_checkpoint; }
-        coroutine::ValueAsync<> append_internal(int8_t type, Span<> record);
+        uint64_t get_segment_start() const noexcept {
+            const auto back = m_files.back().id();
+            if (m_streams.empty()) return back; else return std::min(back, m_streams.begin()->second.first_file);
+        }
+        AppendFile &next_file();
+        AppendFuture append_internal(int8_t type, Span<> prefix, Span<> record);
     };
 
     fs::path prepare_path(const fs::path &path);
@@ -0,0 +1,106 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <mutex>
+#include "Completion.h"
+
+namespace kls::journal {
+    void AppendCompletion::release() noexcept {
+        if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) pool->recycle(this);
+    }
+
+    void AppendCompletion::finish(std::exception_ptr e) noexcept {
+        AppendWaiter *list{};
+        {
+            std::lock_guard lk{lock};
+            error = std::move(e);
+            list = std::exchange(waiters, nullptr);
+            done.store(true, std::memory_order_release);
+        }
+        // the waiter node lives in the frame being resumed, so it is not to be touched after the resumption
+        while (list) std::exchange(list, list->next)->handle.resume();
+    }
+
+    AppendFuture::AppendFuture(AppendCompletion *completion) noexcept: m_completion(completion) {
+        m_completion->acquire();
+    }
+
+    AppendFuture::AppendFuture(const AppendFuture &o) noexcept: m_completion(o.m_completion) {
+        if (m_completion) m_completion->acquire();
+    }
+
+    AppendFuture::~AppendFuture() { if (m_completion) m_completion->release(); }
+
+    bool AppendFuture::Awaiter::await_ready() const noexcept {
+        return m_completion->done.load(std::memory_order_acquire);
+    }
+
+    bool AppendFuture::Awaiter::await_suspend(std::coroutine_handle<> handle) noexcept {
+        std::lock_guard lk{m_completion->lock};
+        if (m_completion->done.load(std::memory_order_relaxed)) return false;
+        m_waiter = AppendWaiter{.handle = handle, .next = m_completion->waiters};
+        m_completion->waiters = &m_waiter;
+        return true;
+    }
+
+    void AppendFuture::Awaiter::await_resume() const {
+        if (m_completion->error) std::rethrow_exception(m_completion->error);
+    }
+}
+
+namespace kls::journal::rotating_file::detail {
+    CompletionPool::CompletionPool() {
+        for (int i = 0; i < Reserved; ++i) m_free = new AppendCompletion{.next = m_free, .pool = this};
+    }
+
+    CompletionPool::~CompletionPool() {
+        while (m_free) delete std::exchange(m_free, m_free->next);
+    }
+
+    AppendCompletion *CompletionPool::rent() {
+        m_refs.fetch_add(1, std::memory_order_relaxed);
+        AppendCompletion *completion{};
+        {
+            std::lock_guard lk{m_lock};
+            if (m_free) completion = std::exchange(m_free, m_free->next);
+        }
+        // only reached when more batches are in flight than ever before
+        if (!completion) completion = new AppendCompletion{.pool = this};
+        completion->refs.store(1, std::memory_order_relaxed);
+        return completion;
+    }
+
+    void CompletionPool::recycle(AppendCompletion *completion) noexcept {
+        completion->done.store(false, std::memory_order_relaxed);
+        completion->error = nullptr;
+        completion->waiters = nullptr;
+        {
+            std::lock_guard lk{m_lock};
+            completion->next = std::exchange(m_free, completion);
+        }
+        release();
+    }
+
+    void CompletionPool::release() noexcept {
+        if (m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+    }
+}
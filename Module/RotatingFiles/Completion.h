@@ -0,0 +1,76 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <exception>
+#include "kls/thread/SpinLock.h"
+#include "kls/journal/Journal.h"
+
+namespace kls::journal::rotating_file::detail { class CompletionPool; }
+
+namespace kls::journal {
+    // completion of a write batch or of the closing of a file, it goes back to its pool once no longer referenced
+    struct AppendCompletion {
+        std::atomic_int32_t refs{0};
+        std::atomic_bool done{false};
+        thread::SpinLock lock{}; // protects the waiter list and the result
+        std::exception_ptr error{};
+        AppendWaiter *waiters{nullptr};
+        AppendCompletion *next{nullptr}; // free list of the pool
+        rotating_file::detail::CompletionPool *pool{nullptr};
+
+        void acquire() noexcept { refs.fetch_add(1, std::memory_order_relaxed); }
+        void release() noexcept;
+        void set() noexcept { finish({}); }
+        void fail(std::exception_ptr e) noexcept { finish(std::move(e)); }
+        void finish(std::exception_ptr e) noexcept;
+    };
+}
+
+namespace kls::journal::rotating_file::detail {
+    // free list of completions shared by the files of a journal. completions still referenced by futures keep the pool
+    // alive after the journal is gone, so the pool is freed by whichever drops the last reference
+    class CompletionPool {
+    public:
+        static constexpr int Reserved = 16;
+        struct Release {
+            void operator()(CompletionPool *pool) const noexcept { pool->release(); }
+        };
+        using Handle = std::unique_ptr<CompletionPool, Release>;
+
+        static Handle create() { return Handle(new CompletionPool()); }
+        // returns a completion holding a single reference
+        [[nodiscard]] AppendCompletion *rent();
+        void recycle(AppendCompletion *completion) noexcept;
+    private:
+        thread::SpinLock m_lock{};
+        AppendCompletion *m_free{nullptr};
+        std::atomic_int64_t m_refs{1}; // the owner and every completion rented out
+
+        CompletionPool();
+        ~CompletionPool();
+        void release() noexcept;
+    };
+}
@@ -20,6 +20,8 @@
 * SOFTWARE.
 */
 
+#include <map>
+#include <memory>
 #include <vector>
 #include "Common.h"
 #include "kls/Format.h"
@@ -37,15 +39,29 @@ namespace kls::journal::rotating_file::detail {
         auto path_string = path.generic_string();
         return io::Block::open(path_string, FileOption);
     }
+
+    // when reassembling, a fragmented record is copied once from the file buffers into its own storage as the fragments
+    // are walked, so the whole record is held in memory until it is yielded. when streaming chunks only the progress
+    // of the record is kept to validate its fragments
+    struct Reassembly {
+        std::unique_ptr<char[]> data;
+        uint64_t size, filled;
+    };
+
+    // records without an end fragment are never released, so the memory for reassembly is bounded as a whole
+    static constexpr uint64_t MaxReassemblySize = 1ull << 30;
 }
 
 namespace kls::journal {
     using namespace kls::coroutine;
     using namespace kls::journal::rotating_file::detail;
 
-    coroutine::AsyncGenerator<JournalRecord> recover_file_journal(std::string_view path) {
+    coroutine::AsyncGenerator<JournalRecord> recover_file_journal(std::string_view path, FragmentMode mode) {
+        const auto reassemble = mode == FragmentMode::Reassemble;
         auto root = prepare_path(fs::absolute(path));
         auto[a, b] = scan_files(root);
+        std::map<uint64_t, Reassembly> streams{};
+        uint64_t reassembly_size{0};
         for (uint64_t id = a; id <= b; ++id) {
             Buffer buffer{};
             auto file = co_await open_with_id(root, id);
@@ -59,8 +75,51 @@ namespace kls::journal {
                 const auto type = int8_t(header & 0xFF);
                 const auto size = int(header >> 8u);
                 if (!file_reader.check<char>(size)) throw std::runtime_error("bad journal");
-                co_yield JournalRecord{.type = type, .data=file_reader.bytes(size)};
+                if (type < RTypeBegin || type > RTypeEnd) {
+                    co_yield JournalRecord{.type = type, .data=file_reader.bytes(size)};
+                    continue;
+                }
+                const auto header_size = (type == RTypeBegin) ? FragmentBeginHeaderSize : FragmentHeaderSize;
+                if (size < header_size) throw std::runtime_error("bad journal");
+                auto fragment_reader = essential::SpanReader<endian>(file_reader.bytes(size));
+                const auto stream = fragment_reader.get<uint64_t>();
+                const auto total = (type == RTypeBegin) ? fragment_reader.get<uint64_t>() : 0;
+                const auto chunk = fragment_reader.bytes(size - header_size);
+                if (type == RTypeBegin) {
+                    // the record cannot be larger than all the files left to be walked
+                    const auto limit = (b - id + 1) * uint64_t(MaxFileSize);
+                    if (!total || total < uint64_t(chunk.size()) || total > limit || streams.contains(stream))
+                        throw std::runtime_error("bad journal");
+                    auto data = std::unique_ptr<char[]>{};
+                    if (reassemble) {
+                        if (total > MaxReassemblySize - reassembly_size)
+                            throw std::runtime_error("journal fragments exceed the reassembly limit");
+                        data.reset(new char[total]);
+                        reassembly_size += total;
+                    }
+                    streams[stream] = Reassembly{std::move(data), total, 0};
+                }
+                // the begin fragment may have been in a file that has been dropped together with a checked segment
+                const auto it = streams.find(stream);
+                if (it == streams.end()) continue;
+                auto &target = it->second;
+                const auto filled = target.filled + chunk.size();
+                if (filled > target.size || (type == RTypeEnd && filled != target.size))
+                    throw std::runtime_error("bad journal");
+                if (!reassemble) {
+                    target.filled = filled;
+                    if (type == RTypeEnd) streams.erase(it);
+                    co_yield JournalRecord{.type = type, .data = chunk, .stream = stream};
+                    continue;
+                }
+                std::ranges::copy(static_span_cast<char>(chunk), target.data.get() + target.filled);
+                target.filled = filled;
+                if (type != RTypeEnd) continue;
+                auto complete = std::move(target);
+                streams.erase(it);
+                reassembly_size -= complete.size;
+                co_yield JournalRecord{.type = RTypeData, .data = Span<>(complete.data.get(), complete.size)};
             }
         }
     }
-}
\ No newline at end of file
+}
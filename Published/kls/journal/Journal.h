@@ -22,6 +22,8 @@
 
 #pragma once
 
+#include <utility>
+#include <coroutine>
 #include "kls/Object.h"
 #include "kls/essential/Memory.h"
 #include "kls/coroutine/Async.h"
@@ -35,12 +37,68 @@ namespace kls::journal {
         [[nodiscard]] virtual coroutine::ValueAsync<> close() = 0;
     };
 
-    std::shared_ptr<AppendJournal> create_file_journal(std::string_view path);
+    struct AppendCompletion;
+
+    // node of the waiter list of a completion, it lives in the awaiter so that waiting does not allocate
+    struct AppendWaiter {
+        std::coroutine_handle<> handle;
+        AppendWaiter *next;
+    };
+
+    // future shared by all the records in a write batch, the completion behind it is pooled by the journal
+    class AppendFuture {
+    public:
+        class Awaiter {
+        public:
+            explicit Awaiter(AppendCompletion *completion) noexcept: m_completion(completion) {}
+            [[nodiscard]] bool await_ready() const noexcept;
+            bool await_suspend(std::coroutine_handle<> handle) noexcept;
+            void await_resume() const;
+        private:
+            AppendCompletion *m_completion;
+            AppendWaiter m_waiter{};
+        };
+
+        AppendFuture() noexcept = default;
+        explicit AppendFuture(AppendCompletion *completion) noexcept;
+        AppendFuture(const AppendFuture &o) noexcept;
+        AppendFuture(AppendFuture &&o) noexcept: m_completion(std::exchange(o.m_completion, nullptr)) {}
+        AppendFuture &operator=(AppendFuture o) noexcept { return (std::swap(m_completion, o.m_completion), *this); }
+        ~AppendFuture();
+        Awaiter operator co_await() const noexcept { return Awaiter(m_completion); }
+    private:
+        AppendCompletion *m_completion{nullptr};
+    };
+
+    struct AppendStatistics {
+        uint64_t batches; // write batches opened so far
+    };
+
+    struct FileJournal: AppendJournal {
+        // opens a record of the given size that is appended as a sequence of chunks, returning its stream id
+        [[nodiscard]] virtual uint64_t begin_record(uint64_t size) = 0;
+        // appends the next chunk of the record, chunks of one record are to be appended in order by a single producer
+        [[nodiscard]] virtual coroutine::ValueAsync<> append_chunk(uint64_t stream, Span<> chunk) = 0;
+        // same as append for records within the maximum record size, but returns the future of the write batch
+        // instead of a coroutine. once the pools of the journal are warmed up, this does not allocate
+        [[nodiscard]] virtual AppendFuture append_batched(Span<> record) = 0;
+        [[nodiscard]] virtual AppendStatistics statistics() const noexcept = 0;
+    };
+
+    std::shared_ptr<FileJournal> create_file_journal(std::string_view path);
 
     struct JournalRecord {
         int8_t type;
         Span<> data;
+        uint64_t stream{}; // the record this fragment chunk belongs to, only set for chunks
+    };
+
+    enum class FragmentMode {
+        Reassemble, // fragmented records are returned as a single record
+        Chunks // fragment chunks are returned as they are walked, tagged with their stream
     };
 
-    coroutine::AsyncGenerator<JournalRecord> recover_file_journal(std::string_view path);
+    coroutine::AsyncGenerator<JournalRecord> recover_file_journal(
+            std::string_view path, FragmentMode mode = FragmentMode::Reassemble
+    );
 }
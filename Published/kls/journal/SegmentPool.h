@@ -0,0 +1,44 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <cstdint>
+
+namespace kls::journal {
+    // Segment buffers are 4MiB regions backed by 2MiB huge pages where the system allows it, and placed on the NUMA
+    // node they are rented for. Returned blocks are kept in a per-node free list so they keep their placement.
+    static constexpr int SegmentBlockSize = 4 << 20;
+
+    // counts how the blocks handed out by the pool have been mapped, blocks reused from a free list are not counted
+    struct SegmentPoolStatistics {
+        uint64_t explicit_huge; // mapped on 2MiB huge pages reserved on the host
+        uint64_t transparent_huge; // mapped on a 2MiB aligned region advised for transparent huge pages
+        uint64_t regular; // mapped on regular pages, as huge pages are refused or not supported
+        uint64_t unbound; // not bound to the requested NUMA node
+    };
+
+    [[nodiscard]] int current_numa_node() noexcept;
+    [[nodiscard]] SegmentPoolStatistics segment_pool_statistics() noexcept;
+    [[nodiscard]] uintptr_t rent_segment_block(int node);
+    void return_segment_block(uintptr_t block, int node) noexcept;
+}
@@ -85,4 +85,152 @@ TEST(kls_journal, JournalEcho) {
         }
     });
     ASSERT_TRUE(success);
-}
\ No newline at end of file
+}
+
+TEST(kls_journal, JournalLargeRecord) {
+    using namespace kls;
+    using namespace kls::journal;
+    using namespace kls::coroutine;
+
+    static constexpr auto payload = std::string_view("Hello World");
+    static constexpr int LargeSize = (9 << 20) + 7;
+    static auto pattern = [](int i) { return char(i * 31 + 7); };
+
+    auto Write = []() -> ValueAsync<bool> {
+        auto append = create_file_journal("./test.kls.journal.large");
+        co_await uses(append, [](FileJournal &file) -> ValueAsync<> {
+            std::string large(size_t(LargeSize), ' ');
+            for (int i = 0; i < LargeSize; ++i) large[i] = pattern(i);
+            co_await awaits(file.append(Span<char>{payload}), file.append(Span<char>{std::string_view(large)}));
+            co_await file.register_checkpoint();
+            co_await file.append(Span<char>{payload});
+            // a record appended as chunks may also fit into its begin fragment
+            co_await file.append_chunk(file.begin_record(payload.size()), Span<char>{payload});
+        });
+        co_return true;
+    };
+
+    auto Read = []() -> ValueAsync<bool> {
+        int small{0}, large{0};
+        auto recover = recover_file_journal("./test.kls.journal.large");
+        while (co_await recover.forward()) {
+            JournalRecord record = recover.next();
+            if (record.type != 0) continue;
+            auto range = static_span_cast<char>(record.data);
+            if (range.size() == LargeSize) {
+                const auto data = range.begin();
+                for (int i = 0; i < LargeSize; ++i) if (data[i] != pattern(i)) co_return false;
+                ++large;
+            }
+            else if (std::string_view(range.begin(), range.end()) == payload) ++small;
+        }
+        co_return small == 3 && large == 1;
+    };
+
+    auto success = run_blocking([&]() -> ValueAsync<bool> {
+        try {
+            auto write = co_await Write();
+            auto read = co_await Read();
+            std::filesystem::remove_all("./test.kls.journal.large");
+            co_return write && read;
+        }
+        catch (...) {
+            std::filesystem::remove_all("./test.kls.journal.large");
+            throw;
+        }
+    });
+    ASSERT_TRUE(success);
+}
+
+TEST(kls_journal, JournalLargeRecordInterleaved) {
+    using namespace kls;
+    using namespace kls::journal;
+    using namespace kls::coroutine;
+
+    static constexpr auto root = std::string_view("./test.kls.journal.mixed");
+    static constexpr int FillerSize = 1000000; // five of them rotate the journal into file 1
+    static constexpr int LargeSize = (12 << 20) + 5;
+    static constexpr int FirstChunk = 6 << 20;
+    static auto pattern = [](int i) { return char(i * 31 + 7); };
+
+    // the large record is appended as two chunks, with the records of another producer and the checkpoint operations
+    // in between. checkpoint 1 is registered while the record is open, so its segment has to start at file 1 where the
+    // record begins rather than at the file the record has reached. checking it must then keep file 1
+    auto Write = []() -> ValueAsync<bool> {
+        auto append = create_file_journal(root);
+        co_await uses(append, [](FileJournal &file) -> ValueAsync<> {
+            const std::string filler(size_t(FillerSize), 'f');
+            for (int i = 0; i < 5; ++i) co_await file.append(Span<char>{std::string_view(filler)});
+            co_await file.register_checkpoint();
+            std::string large(size_t(LargeSize), ' ');
+            for (int i = 0; i < LargeSize; ++i) large[i] = pattern(i);
+            const auto whole = std::string_view(large);
+            const auto stream = file.begin_record(LargeSize);
+            co_await file.append_chunk(stream, Span<char>{whole.substr(0, FirstChunk)});
+            co_await file.append(Span<char>{std::string_view("b0")});
+            co_await file.register_checkpoint();
+            co_await file.append(Span<char>{std::string_view("b1")});
+            co_await file.check_checkpoint();
+            co_await file.append_chunk(stream, Span<char>{whole.substr(FirstChunk)});
+            co_await file.append(Span<char>{std::string_view("b2")});
+            co_await file.check_checkpoint();
+        });
+        co_return !std::filesystem::exists(std::filesystem::path(root) / "0.journal") &&
+                  std::filesystem::exists(std::filesystem::path(root) / "1.journal");
+    };
+
+    // the records of the other producer are all kept, and in the order they are appended
+    auto check_other = [](Span<char> range, int &next) {
+        if (!range.size() || *range.begin() != 'b') return true;
+        return std::string_view(range.begin(), range.end()) == kls::format("b{}", next++);
+    };
+
+    auto Read = [&]() -> ValueAsync<bool> {
+        int next{0}, large{0};
+        auto recover = recover_file_journal(root);
+        while (co_await recover.forward()) {
+            JournalRecord record = recover.next();
+            if (record.type != 0) continue;
+            auto range = static_span_cast<char>(record.data);
+            if (range.size() == LargeSize) {
+                const auto data = range.begin();
+                for (int i = 0; i < LargeSize; ++i) if (data[i] != pattern(i)) co_return false;
+                ++large;
+            }
+            else if (!check_other(range, next)) co_return false;
+        }
+        co_return large == 1 && next == 3;
+    };
+
+    auto ReadChunks = [&]() -> ValueAsync<bool> {
+        int next{0}, ended{0}, filled{0};
+        auto recover = recover_file_journal(root, FragmentMode::Chunks);
+        while (co_await recover.forward()) {
+            JournalRecord record = recover.next();
+            auto range = static_span_cast<char>(record.data);
+            if (record.type == 0 && !check_other(range, next)) co_return false;
+            if (record.type < 2 || record.type > 4) continue;
+            if ((record.type == 2) != (filled == 0)) co_return false;
+            const auto data = range.begin();
+            for (int i = 0; i < range.size(); ++i) if (data[i] != pattern(filled + i)) co_return false;
+            filled += int(range.size());
+            if (record.type == 4) ++ended;
+        }
+        co_return ended == 1 && filled == LargeSize && next == 3;
+    };
+
+    auto success = run_blocking([&]() -> ValueAsync<bool> {
+        try {
+            auto write = co_await Write();
+            auto read = co_await Read();
+            auto chunks = co_await ReadChunks();
+            std::filesystem::remove_all(root);
+            co_return write && read && chunks;
+        }
+        catch (...) {
+            std::filesystem::remove_all(root);
+            throw;
+        }
+    });
+    ASSERT_TRUE(success);
+}
@@ -0,0 +1,67 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <cstring>
+#include <gtest/gtest.h>
+#include "kls/journal/SegmentPool.h"
+
+TEST(kls_journal, SegmentPoolRent) {
+    using namespace kls::journal;
+    const auto node = current_numa_node();
+    ASSERT_GE(node, 0);
+    // two live blocks must never alias each other
+    const auto a = rent_segment_block(node), b = rent_segment_block(node);
+    ASSERT_NE(a, 0u);
+    ASSERT_NE(b, 0u);
+    ASSERT_NE(a, b);
+    std::memset(reinterpret_cast<void *>(a), 1, SegmentBlockSize);
+    std::memset(reinterpret_cast<void *>(b), 2, SegmentBlockSize);
+    ASSERT_EQ(reinterpret_cast<char *>(a)[SegmentBlockSize - 1], 1);
+#if defined(__linux__)
+    // both the explicit huge page mapping and the fallback mapping are aligned to the huge page size
+    ASSERT_EQ(a % (2 << 20), 0u);
+    ASSERT_EQ(b % (2 << 20), 0u);
+#endif
+    // a released block is handed out again from the free list of the same node
+    return_segment_block(b, node);
+    ASSERT_EQ(rent_segment_block(node), b);
+    return_segment_block(b, node);
+    return_segment_block(a, node);
+    // every block has been mapped by exactly one of the paths at some point
+    const auto stats = segment_pool_statistics();
+    ASSERT_GE(stats.explicit_huge + stats.transparent_huge + stats.regular, 2u);
+}
+
+TEST(kls_journal, SegmentPoolNodeRange) {
+    using namespace kls::journal;
+    // out of range node ids share the free list of node 0
+    const auto low = rent_segment_block(-1), high = rent_segment_block(1000);
+    ASSERT_NE(low, 0u);
+    ASSERT_NE(high, 0u);
+    std::memset(reinterpret_cast<void *>(high), 1, SegmentBlockSize);
+    return_segment_block(high, 1000);
+    ASSERT_EQ(rent_segment_block(0), high);
+    return_segment_block(low, -1);
+    ASSERT_EQ(rent_segment_block(0), low);
+    return_segment_block(low, 0);
+    return_segment_block(high, 0);
+}